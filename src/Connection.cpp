@@ -0,0 +1,54 @@
+#include "Connection.h"
+
+namespace websocket_server
+{
+  Connection::Connection(socket_variant_type socket) : socket_(socket)
+  {
+  }
+
+  Connection Connection::remote(remote_socket_type *socket)
+  {
+    return Connection{socket_variant_type{std::in_place_index<remote_index>, socket}};
+  }
+
+  Connection Connection::local(local_socket_type *socket)
+  {
+    return Connection{socket_variant_type{std::in_place_index<local_index>, socket}};
+  }
+
+  Connection::SocketData &Connection::data() const
+  {
+    return *std::visit([](auto socket) { return static_cast<SocketData *>(socket->getUserData()); }, socket_);
+  }
+
+  Connection::user_data_type &Connection::user_data() const
+  {
+    return data().id;
+  }
+
+  bool Connection::is_local() const
+  {
+    return socket_.index() == local_index;
+  }
+
+  bool Connection::dictionary_compression() const
+  {
+    return data().dictionary_compression;
+  }
+
+  std::vector<Connection::shared_message_type> &Connection::pending_messages() const
+  {
+    return data().pending_messages;
+  }
+
+  std::string_view Connection::remote_address() const
+  {
+    return std::visit([](auto socket) { return socket->getRemoteAddressAsText(); }, socket_);
+  }
+
+  void Connection::send(std::string_view message, uWS::OpCode op_code, bool compress) const
+  {
+    // local peers are served without permessage-deflate
+    std::visit([&](auto socket) { socket->send(message, op_code, compress && !is_local()); }, socket_);
+  }
+} // namespace websocket_server
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <App.h>
+
+#include "ClientInfo.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace websocket_server
+{
+#ifdef WS_NO_TLS
+  constexpr bool using_TLS = false;
+#else
+  constexpr bool using_TLS = true;
+#endif
+
+  // a websocket peer, accepted either by the public (optionally TLS) listener or by the local unix domain socket
+  // listener, which never uses TLS.
+  class Connection
+  {
+  public:
+    using remote_socket_type  = uWS::WebSocket<using_TLS, true>;
+    using local_socket_type   = uWS::WebSocket<false, true>;
+    using user_data_type      = ClientInfo::client_id_type;
+    using shared_message_type = std::shared_ptr<const std::string>;
+
+    // per socket storage owned by uWS
+    struct SocketData
+    {
+      user_data_type id;
+      bool dictionary_compression = false;
+
+      // messages waiting for the end of the loop iteration. cleared, not freed, after each flush to reuse its capacity
+      std::vector<shared_message_type> pending_messages;
+    };
+
+    static Connection remote(remote_socket_type *socket);
+    static Connection local(local_socket_type *socket);
+
+    [[nodiscard]] user_data_type &user_data() const;
+    [[nodiscard]] bool is_local() const;
+    [[nodiscard]] bool dictionary_compression() const;
+    [[nodiscard]] std::string_view remote_address() const;
+    [[nodiscard]] std::vector<shared_message_type> &pending_messages() const;
+
+    // identity of the underlying socket, independent of the user data
+    bool operator==(const Connection &) const = default;
+
+    void send(std::string_view message, uWS::OpCode op_code, bool compress) const;
+
+    // sends issued from within callback are buffered and written to the socket together when it returns
+    template <typename Callback>
+    void cork(Callback &&callback) const
+    {
+      std::visit([&callback](auto socket) { socket->cork(std::forward<Callback>(callback)); }, socket_);
+    }
+
+  private:
+    // when built without TLS both alternatives are the same type, so alternatives are always selected by index
+    using socket_variant_type = std::variant<remote_socket_type *, local_socket_type *>;
+
+    static constexpr std::size_t remote_index = 0;
+    static constexpr std::size_t local_index  = 1;
+
+    explicit Connection(socket_variant_type socket);
+
+    [[nodiscard]] SocketData &data() const;
+
+    socket_variant_type socket_;
+  };
+} // namespace websocket_server
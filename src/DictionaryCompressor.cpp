@@ -0,0 +1,195 @@
+#include "DictionaryCompressor.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+
+namespace websocket_server
+{
+  namespace
+  {
+    constexpr auto window_bits = -15; // raw deflate, the version byte replaces the zlib header
+    constexpr auto mem_level   = 8;
+
+    // built from json-encoded browser offers/answers and trickled candidates as the server relays them, i.e. re-serialized
+    // by nlohmann::json with sorted keys and peer_id added. zlib favours matches near the end of the dictionary, so the
+    // most frequent content (message envelopes, candidates) comes last.
+    // changing this string requires bumping DictionaryCompressor::version and the subprotocol name.
+    constexpr std::string_view dictionary =
+        R"sdp(a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level\r\n)sdp"
+        R"sdp(a=extmap:2 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time\r\n)sdp"
+        R"sdp(a=extmap:3 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01\r\n)sdp"
+        R"sdp(a=extmap:4 urn:ietf:params:rtp-hdrext:sdes:mid\r\n)sdp"
+        R"sdp(a=extmap:5 urn:ietf:params:rtp-hdrext:sdes:rtp-stream-id\r\n)sdp"
+        R"sdp(a=extmap:6 urn:ietf:params:rtp-hdrext:sdes:repaired-rtp-stream-id\r\n)sdp"
+        R"sdp(a=extmap:14 urn:ietf:params:rtp-hdrext:toffset\r\na=extmap:13 urn:3gpp:video-orientation\r\n)sdp"
+        R"sdp(a=extmap:12 http://www.webrtc.org/experiments/rtp-hdrext/playout-delay\r\n)sdp"
+        R"sdp(a=extmap:11 http://www.webrtc.org/experiments/rtp-hdrext/video-content-type\r\n)sdp"
+        R"sdp(a=extmap:7 http://www.webrtc.org/experiments/rtp-hdrext/video-timing\r\n)sdp"
+        R"sdp(a=extmap:8 http://www.webrtc.org/experiments/rtp-hdrext/color-space\r\na=rtpmap:96 VP8/90000\r\n)sdp"
+        R"sdp(a=rtcp-fb:96 goog-remb\r\na=rtcp-fb:96 transport-cc\r\na=rtcp-fb:96 ccm fir\r\na=rtcp-fb:96 nack\r\n)sdp"
+        R"sdp(a=rtcp-fb:96 nack pli\r\na=rtpmap:97 rtx/90000\r\na=fmtp:97 apt=96\r\na=rtpmap:98 VP9/90000\r\n)sdp"
+        R"sdp(a=fmtp:98 profile-id=0\r\na=rtpmap:100 VP9/90000\r\na=fmtp:100 profile-id=2\r\n)sdp"
+        R"sdp(a=rtpmap:102 H264/90000\r\n)sdp"
+        R"sdp(a=fmtp:102 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=42001f\r\n)sdp"
+        R"sdp(a=rtpmap:125 H264/90000\r\n)sdp"
+        R"sdp(a=fmtp:125 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=42e01f\r\n)sdp"
+        R"sdp(a=rtpmap:127 H264/90000\r\n)sdp"
+        R"sdp(a=fmtp:127 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=4d001f\r\n)sdp"
+        R"sdp(a=rtpmap:108 H264/90000\r\na=rtpmap:35 AV1/90000\r\na=rtpmap:116 red/90000\r\n)sdp"
+        R"sdp(a=rtpmap:117 ulpfec/90000\r\na=rtpmap:63 red/48000/2\r\na=fmtp:63 111/111\r\n)sdp"
+        R"sdp(a=rtpmap:103 ISAC/16000\r\na=rtpmap:104 ISAC/32000\r\na=rtpmap:9 G722/8000\r\n)sdp"
+        R"sdp(a=rtpmap:0 PCMU/8000\r\na=rtpmap:8 PCMA/8000\r\na=rtpmap:13 CN/8000\r\n)sdp"
+        R"sdp(a=rtpmap:110 telephone-event/48000\r\na=rtpmap:126 telephone-event/8000\r\n)sdp"
+        R"sdp(a=rtpmap:111 opus/48000/2\r\na=rtcp-fb:111 transport-cc\r\na=fmtp:111 minptime=10;useinbandfec=1\r\n)sdp"
+        R"sdp(a=ssrc-group:FID \r\na=ssrc: cname:\r\na=ssrc: msid:\r\na=msid:- \r\na=rtcp-mux\r\na=rtcp-rsize\r\n)sdp"
+        R"sdp(a=sendrecv\r\na=recvonly\r\na=sendonly\r\na=inactive\r\na=setup:actpass\r\na=setup:active\r\n)sdp"
+        R"sdp(a=fingerprint:sha-256 \r\na=ice-options:trickle\r\na=ice-ufrag:\r\na=ice-pwd:\r\na=mid:0\r\n)sdp"
+        R"sdp(a=mid:1\r\nc=IN IP4 0.0.0.0\r\na=rtcp:9 IN IP4 0.0.0.0\r\n)sdp"
+        R"sdp(m=video 9 UDP/TLS/RTP/SAVPF 96 97 98 99 100 101 102 121 127 120 125 107 108 109 35 36 124 119 123 11)sdp"
+        R"sdp(8 114 115 116\r\nm=audio 9 UDP/TLS/RTP/SAVPF 111 63 103 104 9 0 8 106 105 13 110 112 113 126\r\n)sdp"
+        R"sdp(a=group:BUNDLE 0 1\r\na=extmap-allow-mixed\r\na=msid-semantic: WMS\r\nv=0\r\n)sdp"
+        R"sdp(o=- 2 IN IP4 127.0.0.1\r\ns=-\r\nt=0 0\r\n)sdp"
+        R"sdp({"content":"delete","message_type":"SERVER","peer_id":"{"content":"your id","message_type":"SERVER","peer_)sdp"
+        R"sdp(id":""}{"code":"","content":{"sdp":"","type":"answer"},"message_type":"SDP","peer_id":"","type":"offer"},")sdp"
+        R"sdp(message_type":"SDP","peer_id":""}{"code":"","content":{"candidate":"candidate: 1 tcp 1518280447  typ host )sdp"
+        R"sdp(tcptype passive generation 0 ufrag  network-id 1","sdpMLineIndex":1,"sdpMid":"1","usernameFragment":""},"m)sdp"
+        R"sdp(essage_type":"CANDIDATE","peer_id":""}{"code":"","content":{"candidate":"candidate: 1 udp 1686052607  typ )sdp"
+        R"sdp(srflx raddr 0.0.0.0 rport 0 generation 0 ufrag  network-id 1 network-cost 10","sdpMLineIndex":0,"sdpMid":")sdp"
+        R"sdp(0","usernameFragment":""},"message_type":"CANDIDATE","peer_id":""}{"code":"","content":{"candidate":"candi)sdp"
+        R"sdp(date: 1 udp 2122260223 192.168.1.1  typ host generation 0 ufrag  network-id 1 network-cost 10","sdpMLineIn)sdp"
+        R"sdp(dex":0,"sdpMid":"0","usernameFragment":""},"message_type":"CANDIDATE","peer_id":")sdp";
+
+    const Bytef *dictionary_data()
+    {
+      return reinterpret_cast<const Bytef *>(dictionary.data());
+    }
+  } // namespace
+
+  bool DictionaryCompressor::requested(std::string_view protocols)
+  {
+    while (!protocols.empty())
+    {
+      auto separator = protocols.find(',');
+      auto protocol  = protocols.substr(0, separator);
+
+      protocol.remove_prefix(std::min(protocol.find_first_not_of(' '), protocol.size()));
+      protocol.remove_suffix(protocol.size() - std::min(protocol.find_last_not_of(' ') + 1, protocol.size()));
+
+      if (protocol == subprotocol)
+      {
+        return true;
+      }
+
+      protocols.remove_prefix((separator == std::string_view::npos) ? protocols.size() : separator + 1);
+    }
+
+    return false;
+  }
+
+  void DictionaryCompressor::stream_deleter::operator()(z_stream_s *stream) const
+  {
+    delete stream;
+  }
+
+  DictionaryCompressor::DictionaryCompressor() : deflate_stream_(new z_stream{}), inflate_stream_(new z_stream{})
+  {
+    deflate_ready_ = (deflateInit2(deflate_stream_.get(),
+                                   Z_DEFAULT_COMPRESSION,
+                                   Z_DEFLATED,
+                                   window_bits,
+                                   mem_level,
+                                   Z_DEFAULT_STRATEGY) == Z_OK);
+    inflate_ready_ = (inflateInit2(inflate_stream_.get(), window_bits) == Z_OK);
+  }
+
+  DictionaryCompressor::~DictionaryCompressor()
+  {
+    if (deflate_ready_)
+    {
+      deflateEnd(deflate_stream_.get());
+    }
+    if (inflate_ready_)
+    {
+      inflateEnd(inflate_stream_.get());
+    }
+  }
+
+  std::optional<std::string> DictionaryCompressor::compress(std::string_view message)
+  {
+    auto *stream = deflate_stream_.get();
+
+    // raw deflate forgets the dictionary on reset, so it has to be primed for every message
+    if (!deflate_ready_ || deflateReset(stream) != Z_OK ||
+        deflateSetDictionary(stream, dictionary_data(), static_cast<uInt>(dictionary.size())) != Z_OK)
+    {
+      return std::nullopt;
+    }
+
+    std::string frame(1 + deflateBound(stream, static_cast<uLong>(message.size())), '\0');
+    frame[0] = static_cast<char>(version);
+
+    stream->next_in   = reinterpret_cast<Bytef *>(const_cast<char *>(message.data()));
+    stream->avail_in  = static_cast<uInt>(message.size());
+    stream->next_out  = reinterpret_cast<Bytef *>(frame.data() + 1);
+    stream->avail_out = static_cast<uInt>(frame.size() - 1);
+
+    // deflateBound() guarantees the whole stream fits, so anything but Z_STREAM_END is an error
+    if (deflate(stream, Z_FINISH) != Z_STREAM_END)
+    {
+      return std::nullopt;
+    }
+
+    frame.resize(frame.size() - stream->avail_out);
+
+    return frame;
+  }
+
+  std::optional<std::string> DictionaryCompressor::decompress(std::string_view frame)
+  {
+    if (!inflate_ready_ || frame.empty() || static_cast<std::uint8_t>(frame[0]) != version)
+    {
+      return std::nullopt;
+    }
+
+    auto *stream = inflate_stream_.get();
+
+    if (inflateReset(stream) != Z_OK ||
+        inflateSetDictionary(stream, dictionary_data(), static_cast<uInt>(dictionary.size())) != Z_OK)
+    {
+      return std::nullopt;
+    }
+
+    constexpr std::size_t chunk_size = 16 * 1024;
+
+    std::string message;
+    stream->next_in  = reinterpret_cast<Bytef *>(const_cast<char *>(frame.data() + 1));
+    stream->avail_in = static_cast<uInt>(frame.size() - 1);
+
+    auto result = Z_OK;
+    while (result == Z_OK)
+    {
+      if (message.size() >= max_decompressed_size)
+      {
+        return std::nullopt;
+      }
+
+      auto offset = message.size();
+      message.resize(offset + chunk_size);
+
+      stream->next_out  = reinterpret_cast<Bytef *>(message.data() + offset);
+      stream->avail_out = static_cast<uInt>(chunk_size);
+
+      result = inflate(stream, Z_NO_FLUSH);
+
+      message.resize(message.size() - stream->avail_out);
+    }
+
+    if (result != Z_STREAM_END || message.size() > max_decompressed_size)
+    {
+      return std::nullopt;
+    }
+
+    return message;
+  }
+} // namespace websocket_server
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+struct z_stream_s;
+
+namespace websocket_server
+{
+  // raw deflate primed with a preset dictionary of typical SDP/candidate signalling messages, negotiated per client via
+  // the websocket subprotocol. each frame is self contained: a dictionary version byte followed by the deflate stream.
+  // capable clients must still accept plain text frames, which the server falls back to whenever compression fails.
+  class DictionaryCompressor
+  {
+  public:
+    static constexpr std::uint8_t version = 1;
+    static constexpr auto subprotocol     = "decibel-sdp-deflate-1";
+
+    // upper bound for inflated messages, so a small frame cannot expand without limit
+    static constexpr std::size_t max_decompressed_size = 1024 * 1024;
+
+    [[nodiscard]] static bool requested(std::string_view protocols);
+
+    DictionaryCompressor();
+    ~DictionaryCompressor();
+
+    DictionaryCompressor(const DictionaryCompressor &) = delete;
+    DictionaryCompressor &operator=(const DictionaryCompressor &) = delete;
+
+    // nullopt if zlib failed, in which case the message should be sent uncompressed
+    [[nodiscard]] std::optional<std::string> compress(std::string_view message);
+    [[nodiscard]] std::optional<std::string> decompress(std::string_view frame);
+
+  private:
+    struct stream_deleter
+    {
+      void operator()(z_stream_s *stream) const;
+    };
+    using stream_type = std::unique_ptr<z_stream_s, stream_deleter>;
+
+    stream_type deflate_stream_;
+    stream_type inflate_stream_;
+    bool deflate_ready_;
+    bool inflate_ready_;
+  };
+} // namespace websocket_server
@@ -0,0 +1,204 @@
+// Measures dictionary compression against the plain permessage-deflate the server uses otherwise.
+//
+// Reads a capture of signalling messages, one per line: either bare json messages or the server's log file (which always
+// logs at trace level), in which case the json is taken from the first '{' of every line. Every message is
+// re-serialized the way the server relays it (nlohmann::json, sorted keys, peer_id added) and then compressed
+//   - as uWS' SHARED_COMPRESSOR does it: raw deflate with a 32KB window, Z_SYNC_FLUSH with the trailing 00 00 ff ff
+//     stripped and the stream reset after every message, and
+//   - with DictionaryCompressor.
+// For both it reports the compression ratio and the time spent per message.
+//
+// test/data/signalling_capture.jsonl holds 50 synthetic Chrome offers and 500 trickled candidates in the server's
+// serialization; the figures quoted for the dictionary were measured on it:
+//   dictionary_bench -f test/data/signalling_capture.jsonl
+//   dictionary_bench -f logs/decibel.log
+
+#include "DictionaryCompressor.h"
+
+#include <cxxopts.hpp>
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+#include <zlib.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+  using json = nlohmann::json;
+
+  struct Options
+  {
+    std::string capture_file;
+    std::size_t iterations;
+  };
+
+  // the compression uWS applies to TEXT frames sent with compress = true on a SHARED_COMPRESSOR behaviour
+  class PermessageDeflate
+  {
+  public:
+    PermessageDeflate()
+    {
+      if (deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      {
+        throw std::runtime_error("deflateInit2 failed");
+      }
+    }
+
+    ~PermessageDeflate()
+    {
+      deflateEnd(&stream_);
+    }
+
+    PermessageDeflate(const PermessageDeflate &) = delete;
+    PermessageDeflate &operator=(const PermessageDeflate &) = delete;
+
+    std::size_t compress(std::string_view message)
+    {
+      buffer_.resize(deflateBound(&stream_, static_cast<uLong>(message.size())) + 16);
+
+      stream_.next_in   = reinterpret_cast<Bytef *>(const_cast<char *>(message.data()));
+      stream_.avail_in  = static_cast<uInt>(message.size());
+      stream_.next_out  = reinterpret_cast<Bytef *>(buffer_.data());
+      stream_.avail_out = static_cast<uInt>(buffer_.size());
+
+      if (deflate(&stream_, Z_SYNC_FLUSH) != Z_OK)
+      {
+        throw std::runtime_error("deflate failed");
+      }
+      deflateReset(&stream_);
+
+      // permessage-deflate drops the empty stored block that ends every sync flush
+      return buffer_.size() - stream_.avail_out - 4;
+    }
+
+  private:
+    z_stream stream_{};
+    std::string buffer_;
+  };
+
+  std::vector<std::string> read_capture(const std::string &file)
+  {
+    std::ifstream stream(file);
+    if (!stream)
+    {
+      throw std::runtime_error(fmt::format("unable to open {}", file));
+    }
+
+    std::vector<std::string> messages;
+    std::string line;
+    while (std::getline(stream, line))
+    {
+      auto start = line.find('{');
+      if (start == std::string::npos)
+      {
+        continue;
+      }
+
+      auto message = json::parse(line.begin() + start, line.end(), nullptr, false);
+      if (message.is_discarded() || !message.is_object() || !message.contains("message_type"))
+      {
+        continue;
+      }
+
+      // messages logged on receipt don't carry the sender's id yet
+      if (!message.contains("peer_id"))
+      {
+        message["peer_id"] = "00000000-0000-0000-0000-000000000000";
+      }
+
+      messages.push_back(message.dump());
+    }
+
+    return messages;
+  }
+
+  void report(std::string_view name,
+              const std::vector<std::string> &messages,
+              std::size_t iterations,
+              const std::function<std::size_t(std::string_view)> &compress)
+  {
+    std::size_t raw        = 0;
+    std::size_t compressed = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t iteration = 0; iteration < iterations; ++iteration)
+    {
+      for (const auto &message : messages)
+      {
+        raw += message.size();
+        compressed += compress(message);
+      }
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+    fmt::print("{:<22} {:>10} -> {:>10} bytes, ratio {:.3f}, {:.2f} us/message\n",
+               name,
+               raw / iterations,
+               compressed / iterations,
+               static_cast<double>(compressed) / static_cast<double>(raw),
+               elapsed.count() / static_cast<double>(iterations * messages.size()));
+  }
+
+  Options parse_arguments(int argc, char **argv)
+  {
+    Options params;
+
+    cxxopts::Options options(argv[0], "Compare dictionary compression with plain permessage-deflate");
+    options.add_options()("h,help", "Print usage");
+    options.add_options()("f,file", "Capture file, json messages or server trace log", cxxopts::value(params.capture_file));
+    options.add_options()(
+        "iterations", "Passes over the capture", cxxopts::value(params.iterations)->default_value("10"));
+
+    auto result = options.parse(argc, argv);
+    if (result.count("help") > 0 || result.count("file") == 0 || params.iterations == 0)
+    {
+      fmt::print(stderr, "{}\n", options.help());
+      std::exit(EXIT_FAILURE);
+    }
+
+    return params;
+  }
+} // namespace
+
+int main(int argc, char **argv)
+{
+  using websocket_server::DictionaryCompressor;
+
+  auto options  = parse_arguments(argc, argv);
+  auto messages = read_capture(options.capture_file);
+  if (messages.empty())
+  {
+    fmt::print(stderr, "no signalling messages found in {}\n", options.capture_file);
+    return EXIT_FAILURE;
+  }
+
+  DictionaryCompressor dictionary;
+  for (const auto &message : messages)
+  {
+    auto frame = dictionary.compress(message);
+    if (!frame || dictionary.decompress(*frame) != message)
+    {
+      fmt::print(stderr, "dictionary round trip failed for: {}\n", message);
+      return EXIT_FAILURE;
+    }
+  }
+
+  fmt::print("{} messages from {}, {} passes\n", messages.size(), options.capture_file, options.iterations);
+
+  PermessageDeflate permessage_deflate;
+  report("permessage-deflate", messages, options.iterations, [&permessage_deflate](std::string_view message) {
+    return permessage_deflate.compress(message);
+  });
+  report(DictionaryCompressor::subprotocol, messages, options.iterations, [&dictionary](std::string_view message) {
+    auto frame = dictionary.compress(message);
+    return frame ? frame->size() : message.size();
+  });
+}
@@ -0,0 +1,377 @@
+// Load driver for the relay fan-out path.
+//
+// Connects rooms * peers websocket clients to the server's local unix domain socket listener (no TLS, no compression),
+// lets every client send a burst of messages to its room and reports the relay throughput. With --server_pid and
+// --count_syscalls it additionally attaches `strace -c` to the server for the measured window and reports the server's
+// socket write syscalls per delivered message. strace slows the server down considerably, so take throughput from a run
+// without it.
+//
+// Comparing batched fan-out with the previous one-write-per-send behaviour (start a fresh server for every run):
+//   server -l /tmp/decibel.sock [--unbatched_fan_out] & fanout_bench -s /tmp/decibel.sock
+//   server -l /tmp/decibel.sock [--unbatched_fan_out] & fanout_bench -s /tmp/decibel.sock --count_syscalls --server_pid $!
+
+#include <cxxopts.hpp>
+
+#include <fmt/format.h>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  struct Options
+  {
+    std::string socket_path;
+    std::size_t rooms;
+    std::size_t peers;
+    std::size_t messages;
+    std::size_t payload_size;
+    int server_pid;
+    bool count_syscalls;
+  };
+
+  class Client
+  {
+  public:
+    Client(const std::string &socket_path, std::string room) : room_(std::move(room))
+    {
+      fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+      sockaddr_un address{};
+      address.sun_family = AF_UNIX;
+      std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+      if (fd_ < 0 || ::connect(fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+      {
+        throw std::runtime_error(fmt::format("unable to connect to {}: {}", socket_path, std::strerror(errno)));
+      }
+
+      write_all("GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+
+      while (input_.find("\r\n\r\n") == std::string::npos)
+      {
+        read_some();
+      }
+      input_.erase(0, input_.find("\r\n\r\n") + 4);
+    }
+
+    ~Client()
+    {
+      ::close(fd_);
+    }
+
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+
+    [[nodiscard]] int fd() const
+    {
+      return fd_;
+    }
+
+    void send(std::string_view payload)
+    {
+      std::string frame;
+      frame.push_back(static_cast<char>(0x81)); // FIN + text
+
+      // client frames must be masked, an all-zero mask keeps the payload as is
+      if (payload.size() < 126)
+      {
+        frame.push_back(static_cast<char>(0x80 | payload.size()));
+      }
+      else if (payload.size() <= 0xffff)
+      {
+        frame.push_back(static_cast<char>(0x80 | 126));
+        frame.push_back(static_cast<char>(payload.size() >> 8));
+        frame.push_back(static_cast<char>(payload.size() & 0xff));
+      }
+      else
+      {
+        frame.push_back(static_cast<char>(0x80 | 127));
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+          frame.push_back(static_cast<char>((static_cast<std::uint64_t>(payload.size()) >> shift) & 0xff));
+        }
+      }
+      frame.append(4, '\0');
+      frame.append(payload);
+
+      write_all(frame);
+    }
+
+    void send_to_room(std::size_t payload_size)
+    {
+      send(fmt::format(R"({{"code":"{}","content":"{}","message_type":"CANDIDATE"}})", room_, std::string(payload_size, 'x')));
+    }
+
+    // reads whatever is available and returns the number of complete frames received
+    std::size_t receive()
+    {
+      read_some();
+
+      std::size_t frames = 0;
+      while (true)
+      {
+        if (input_.size() < 2)
+        {
+          break;
+        }
+
+        std::size_t length = static_cast<unsigned char>(input_[1]) & 0x7f;
+        std::size_t header = 2;
+        if (length == 126)
+        {
+          if (input_.size() < 4)
+          {
+            break;
+          }
+          length = (static_cast<std::size_t>(static_cast<unsigned char>(input_[2])) << 8) |
+                   static_cast<unsigned char>(input_[3]);
+          header = 4;
+        }
+        else if (length == 127)
+        {
+          if (input_.size() < 10)
+          {
+            break;
+          }
+          length = 0;
+          for (std::size_t ii = 2; ii < 10; ++ii)
+          {
+            length = (length << 8) | static_cast<unsigned char>(input_[ii]);
+          }
+          header = 10;
+        }
+
+        if (input_.size() < header + length)
+        {
+          break;
+        }
+
+        input_.erase(0, header + length);
+        ++frames;
+      }
+
+      return frames;
+    }
+
+  private:
+    void write_all(std::string_view data)
+    {
+      while (!data.empty())
+      {
+        auto written = ::write(fd_, data.data(), data.size());
+        if (written < 0)
+        {
+          if (errno == EINTR || errno == EAGAIN)
+          {
+            continue;
+          }
+          throw std::runtime_error(fmt::format("write failed: {}", std::strerror(errno)));
+        }
+        data.remove_prefix(static_cast<std::size_t>(written));
+      }
+    }
+
+    void read_some()
+    {
+      char buffer[64 * 1024];
+      auto count = ::read(fd_, buffer, sizeof(buffer));
+      if (count <= 0)
+      {
+        throw std::runtime_error("connection closed by server");
+      }
+      input_.append(buffer, static_cast<std::size_t>(count));
+    }
+
+    int fd_;
+    std::string room_;
+    std::string input_;
+  };
+
+  // sends `to_send` room messages from every client while receiving, until `expected` frames have arrived in total
+  void exchange(std::vector<std::unique_ptr<Client>> &clients,
+                std::size_t to_send,
+                std::size_t payload_size,
+                std::size_t expected)
+  {
+    std::vector<pollfd> fds;
+    std::vector<std::size_t> remaining(clients.size(), to_send);
+    for (const auto &client : clients)
+    {
+      fds.push_back({client->fd(), POLLIN, 0});
+    }
+
+    std::size_t received = 0;
+    while (received < expected)
+    {
+      for (std::size_t ii = 0; ii < fds.size(); ++ii)
+      {
+        fds[ii].events = (remaining[ii] > 0) ? (POLLIN | POLLOUT) : POLLIN;
+      }
+
+      if (::poll(fds.data(), fds.size(), 10000) <= 0)
+      {
+        throw std::runtime_error(fmt::format("timed out after {} of {} messages", received, expected));
+      }
+
+      for (std::size_t ii = 0; ii < fds.size(); ++ii)
+      {
+        if (fds[ii].revents & POLLIN)
+        {
+          received += clients[ii]->receive();
+        }
+        if ((fds[ii].revents & POLLOUT) && remaining[ii] > 0)
+        {
+          clients[ii]->send_to_room(payload_size);
+          --remaining[ii];
+        }
+      }
+    }
+  }
+
+  pid_t start_strace(int server_pid, const std::string &output)
+  {
+    auto pid = ::fork();
+    if (pid == 0)
+    {
+      auto target = std::to_string(server_pid);
+      // plain write() is left out on purpose: the server's log file sink uses it, uSockets writes with send()/writev()
+      ::execlp("strace",
+               "strace",
+               "-f",
+               "-c",
+               "-e",
+               "trace=sendto,sendmsg,writev",
+               "-o",
+               output.c_str(),
+               "-p",
+               target.c_str(),
+               nullptr);
+      std::_Exit(127);
+    }
+
+    // give strace time to attach before the measured window starts
+    std::this_thread::sleep_for(std::chrono::seconds{1});
+    return pid;
+  }
+
+  std::size_t stop_strace(pid_t pid, const std::string &output)
+  {
+    ::kill(pid, SIGINT);
+    ::waitpid(pid, nullptr, 0);
+
+    // the summary ends with "100.00  <seconds>  <usecs/call>  <calls>  [errors]  total"
+    std::ifstream stream(output);
+    std::string line;
+    while (std::getline(stream, line))
+    {
+      if (line.find("total") != std::string::npos)
+      {
+        std::istringstream fields(line);
+        std::string percent, seconds, usecs;
+        std::size_t calls = 0;
+        fields >> percent >> seconds >> usecs >> calls;
+        return calls;
+      }
+    }
+
+    throw std::runtime_error(fmt::format("no strace summary in {}", output));
+  }
+
+  Options parse_arguments(int argc, char **argv)
+  {
+    Options params;
+
+    cxxopts::Options options(argv[0], "Measure relay throughput and write syscalls per message");
+    options.add_options()("h,help", "Print usage");
+    options.add_options()("s,socket", "The server's local unix domain socket", cxxopts::value(params.socket_path));
+    options.add_options()("rooms", "Number of rooms", cxxopts::value(params.rooms)->default_value("50"));
+    options.add_options()("peers", "Peers per room", cxxopts::value(params.peers)->default_value("8"));
+    options.add_options()("messages", "Messages sent by each peer", cxxopts::value(params.messages)->default_value("200"));
+    options.add_options()("payload", "Payload size in bytes", cxxopts::value(params.payload_size)->default_value("200"));
+    options.add_options()(
+        "server_pid", "Pid of the server, for --count_syscalls", cxxopts::value(params.server_pid)->default_value("0"));
+    options.add_options()(
+        "count_syscalls", "Count the server's socket write syscalls with strace", cxxopts::value(params.count_syscalls));
+
+    auto result = options.parse(argc, argv);
+    if (result.count("help") > 0 || result.count("socket") == 0 || (params.count_syscalls && params.server_pid == 0))
+    {
+      fmt::print(stderr, "{}\n", options.help());
+      std::exit(EXIT_FAILURE);
+    }
+
+    return params;
+  }
+} // namespace
+
+int main(int argc, char **argv)
+{
+  auto options = parse_arguments(argc, argv);
+
+  std::vector<std::unique_ptr<Client>> clients;
+  for (std::size_t room = 0; room < options.rooms; ++room)
+  {
+    for (std::size_t peer = 0; peer < options.peers; ++peer)
+    {
+      clients.push_back(std::make_unique<Client>(options.socket_path, fmt::format("bench-{}", room)));
+    }
+  }
+
+  // join every room one peer at a time: each join yields the "your id" reply plus one relay per peer already present
+  for (std::size_t ii = 0; ii < clients.size(); ++ii)
+  {
+    clients[ii]->send_to_room(0);
+    exchange(clients, 0, 0, 1 + ii % options.peers);
+  }
+
+  const auto delivered = options.rooms * options.peers * (options.peers - 1) * options.messages;
+  const auto strace_output = fmt::format("/tmp/fanout_bench.{}.strace", ::getpid());
+
+  pid_t strace = 0;
+  if (options.count_syscalls)
+  {
+    strace = start_strace(options.server_pid, strace_output);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  exchange(clients, options.messages, options.payload_size, delivered);
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  fmt::print("{} rooms x {} peers, {} messages each: {} relayed messages delivered in {:.3f} s ({:.0f} messages/s)\n",
+             options.rooms,
+             options.peers,
+             options.messages,
+             delivered,
+             elapsed.count(),
+             static_cast<double>(delivered) / elapsed.count());
+
+  if (options.count_syscalls)
+  {
+    auto syscalls = stop_strace(strace, strace_output);
+    fmt::print("server write syscalls: {} ({:.3f} per delivered message)\n",
+               syscalls,
+               static_cast<double>(syscalls) / static_cast<double>(delivered));
+  }
+}
@@ -36,6 +36,25 @@ websocket_server::Parameters parse_arguments(int argc, char **argv)
                           cxxopts::value<decltype(Parameters::max_log_mb)>(params.max_log_mb)->default_value("0"));
     options.add_options()(
         "o,logger_output_file", "Filename for logs.", cxxopts::value<decltype(Parameters::log_file)>(params.log_file));
+    options.add_options()("l,local_socket",
+                          "Path of a unix domain socket to additionally accept local, uncompressed, non-TLS connections on. "
+                          "Only the server's user and group may connect (mode 0660).",
+                          cxxopts::value<decltype(Parameters::local_socket)>(params.local_socket));
+    options.add_options()("unbatched_fan_out",
+                          "Send each relayed message immediately instead of batching per peer and loop iteration.");
+    options.add_options()("trace_sample_period",
+                          "Trace 1 in every N relayed messages, and separately 1 in every N disconnects. "
+                          "Default is 0, or disabled.",
+                          cxxopts::value<decltype(Parameters::trace_sample_period)>(params.trace_sample_period)
+                              ->default_value("0")
+                              ->implicit_value("100"));
+    options.add_options()(
+        "trace_buffer_events",
+        "Number of trace events kept per thread.",
+        cxxopts::value<decltype(Parameters::trace_buffer_events)>(params.trace_buffer_events)->default_value("65536"));
+    options.add_options()("trace_output_file",
+                          "Filename for chrome trace dumps, written on SIGUSR1.",
+                          cxxopts::value<decltype(Parameters::trace_file)>(params.trace_file));
 
     auto result = options.parse(argc, argv);
 
@@ -74,6 +93,14 @@ websocket_server::Parameters parse_arguments(int argc, char **argv)
     }
     params.log_file = websocket_server::fs::absolute(params.log_file);
 
+    params.batch_fan_out = (result.count("unbatched_fan_out") == 0);
+
+    if (result.count("trace_output_file") == 0)
+    {
+      params.trace_file = params.log_file.parent_path() / "trace.json";
+    }
+    params.trace_file = websocket_server::fs::absolute(params.trace_file);
+
     if constexpr (websocket_server::using_TLS)
     {
       handle_required_argument("certfile");
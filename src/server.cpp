@@ -1,6 +1,7 @@
 #include "server.hpp"
 
 #include "MessageType.hpp"
+#include "tracing.hpp"
 
 #include <fmt/chrono.h>
 #include <fmt/color.h>
@@ -11,8 +12,12 @@
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <bit>
 #include <chrono>
+#include <csignal>
 #include <utility>
+#include <vector>
 
 template <>
 struct fmt::formatter<websocket_server::WSS::connection_type> : formatter<std::string>
@@ -109,10 +114,100 @@ namespace websocket_server
   constexpr auto logger_name_console = "decibel console";
   constexpr auto logger_name_error   = "decibel errors";
   constexpr auto logger_name_file    = "decibel log file";
+  constexpr auto trace_route         = "/debug/trace";
+
+  namespace
+  {
+    std::atomic<bool> room_dump_requested{false};
+
+    void handle_room_dump_signal(int /*signal*/)
+    {
+      room_dump_requested.store(true, std::memory_order_relaxed);
+    }
+  } // namespace
+
+  template <bool Local>
+  auto WSS::make_behavior()
+  {
+    using backend_type = std::conditional_t<Local, local_backend_type, server_backend_type>;
+
+    auto connection = [](auto ws) {
+      if constexpr (Local)
+      {
+        return Connection::local(ws);
+      }
+      else
+      {
+        return Connection::remote(ws);
+      }
+    };
+
+    return typename backend_type::WebSocketBehavior{
+        .compression = (compress_outgoing_messages && !Local) ? uWS::CompressOptions::SHARED_COMPRESSOR :
+                                                                 uWS::CompressOptions::DISABLED,
+        .upgrade =
+            [](auto response, auto request, auto context) {
+              auto protocols = request->getHeader("sec-websocket-protocol");
+
+              // clients that don't ask for the dictionary subprotocol keep the plain permessage-deflate behaviour
+              Connection::SocketData data{
+                  .dictionary_compression = !Local && offer_dictionary_compression && DictionaryCompressor::requested(protocols)};
+              auto protocol = data.dictionary_compression ? DictionaryCompressor::subprotocol : protocols;
+
+              response->template upgrade<Connection::SocketData>(std::move(data),
+                                                                  request->getHeader("sec-websocket-key"),
+                                                                  protocol,
+                                                                  request->getHeader("sec-websocket-extensions"),
+                                                                  context);
+            },
+        .open = [this, connection](auto ws) { http_handler(connection(ws)); },
+        .message =
+            [this, connection](auto ws, auto message, auto op_code) {
+              auto handle = connection(ws);
+
+              if (op_code == uWS::OpCode::TEXT || (Local && op_code == uWS::OpCode::BINARY))
+              {
+                message_handler(handle, message);
+              }
+              else if (op_code == uWS::OpCode::BINARY && handle.dictionary_compression())
+              {
+                if (auto decompressed = dictionary_compressor_.decompress(message))
+                {
+                  message_handler(handle, *decompressed);
+                }
+                else
+                {
+                  log(spdlog::level::warn,
+                      fmt::color::orange_red,
+                      "unable to decompress message from {} ({} bytes)",
+                      user_data(handle),
+                      message.size());
+                }
+              }
+              else
+              {
+                log(spdlog::level::warn,
+                    fmt::color::orange_red,
+                    "cannot handle received message of type: {} [{}]",
+                    static_cast<int>(op_code),
+                    message);
+              }
+            },
+        .close =
+            [this, connection](auto ws, auto code, auto message) {
+              log(spdlog::level::debug, fmt::color::dark_turquoise, "{}: {}", code, message);
+
+              remove_client_from_room(connection(ws));
+            },
+    };
+  }
 
   WSS::WSS(const Parameters &params) :
       key_(params.key_file.string()),
       cert_(params.cert_file.string()),
+      trace_file_(params.trace_file),
+      local_socket_(params.local_socket),
+      batch_fan_out_(params.batch_fan_out),
       server_([this]() {
         if constexpr (using_TLS)
         {
@@ -120,37 +215,37 @@ namespace websocket_server
         }
         return uWS::SocketContextOptions{};
       }()),
+      local_listen_socket_(nullptr),
+      loop_(uWS::Loop::get()),
+      flush_sampled_(false),
+      sent_messages_(0),
+      peer_flushes_(0),
+      dictionary_bytes_in_(0),
+      dictionary_bytes_out_(0),
+      membership_version_(0),
+      client_count_(0),
+      room_size_histogram_{},
       run_debug_logger_(true)
   {
     initialize_loggers(params);
+    tracing::configure(params.trace_sample_period, params.trace_buffer_events);
+
+    server_.ws<Connection::SocketData>("/*", make_behavior<false>());
+
+    loop_->addPostHandler(this, [this](uWS::Loop * /*loop*/) { flush_pending_messages(); });
+
+    if (tracing::enabled())
+    {
+      log(spdlog::level::info,
+          "tracing 1 in {} relays and removals each, dump with SIGUSR1 to {}",
+          params.trace_sample_period,
+          trace_file_.string());
+    }
+
+#ifdef SIGUSR2
+    std::signal(SIGUSR2, handle_room_dump_signal);
+#endif
 
-    server_.ws<user_data_type>("/*",
-                               {
-                                   .compression = (compress_outgoing_messages) ? uWS::CompressOptions::SHARED_COMPRESSOR :
-                                                                                 uWS::CompressOptions::DISABLED,
-                                   .open        = [this](auto ws) { http_handler(ws); },
-                                   .message =
-                                       [this](auto ws, auto message, auto op_code) {
-                                         if (op_code == uWS::OpCode::TEXT)
-                                         {
-                                           message_handler(ws, message);
-                                         }
-                                         else
-                                         {
-                                           log(spdlog::level::warn,
-                                               fmt::color::orange_red,
-                                               "cannot handle received message of type: {} [{}]",
-                                               static_cast<int>(op_code),
-                                               message);
-                                         }
-                                       },
-                                   .close =
-                                       [this](auto ws, auto code, auto message) {
-                                         log(spdlog::level::debug, fmt::color::dark_turquoise, "{}: {}", code, message);
-
-                                         remove_client_from_room(ws);
-                                       },
-                               });
     server_.listen(params.port, [port = params.port](auto listen_socket) {
       if (listen_socket)
       {
@@ -162,11 +257,80 @@ namespace websocket_server
       }
     });
 
+    if (!local_socket_.empty())
+    {
+      local_server_.ws<Connection::SocketData>("/*", make_behavior<true>());
+
+      // serializing the trace blocks the event loop, so it is only offered to local clients, never on the public port
+      if (tracing::enabled())
+      {
+        local_server_.get(trace_route, [](auto response, auto /*request*/) {
+          response->writeHeader("Content-Type", "application/json")->end(tracing::chrome_trace());
+        });
+
+        log(spdlog::level::info, "trace also available from GET {} on {}", trace_route, local_socket_.string());
+      }
+
+      listen_local();
+    }
+
     debug_logger_ = thread_type{[this]() {
-      constexpr auto interval = std::chrono::seconds{1};
+      constexpr auto interval      = std::chrono::seconds{1};
+      std::uint64_t logged_version = 0;
+      std::uint64_t logged_sent    = 0;
+      std::uint64_t logged_flushes = 0;
+      std::uint64_t logged_in      = 0;
+      std::uint64_t logged_out     = 0;
       while (run_debug_logger_.load(std::memory_order_acquire))
       {
-        log(spdlog::level::debug, fmt::color::violet, "Rooms:{}{:2}", rooms_.empty() ? "" : "\n", rooms_);
+        // only summarize when membership actually changed since the last summary
+        auto version = membership_version_.load(std::memory_order_acquire);
+        if (version != logged_version)
+        {
+          log_membership_summary();
+          logged_version = version;
+        }
+
+        auto sent    = sent_messages_.load(std::memory_order_relaxed);
+        auto flushes = peer_flushes_.load(std::memory_order_relaxed);
+        if (flushes != logged_flushes)
+        {
+          log(spdlog::level::debug,
+              fmt::color::violet,
+              "Fan-out: {} messages in {} peer flushes ({:.2f} messages per flush)",
+              sent - logged_sent,
+              flushes - logged_flushes,
+              static_cast<double>(sent - logged_sent) / static_cast<double>(flushes - logged_flushes));
+          logged_sent    = sent;
+          logged_flushes = flushes;
+        }
+
+        auto bytes_in  = dictionary_bytes_in_.load(std::memory_order_relaxed);
+        auto bytes_out = dictionary_bytes_out_.load(std::memory_order_relaxed);
+        if (bytes_in != logged_in)
+        {
+          log(spdlog::level::debug,
+              fmt::color::violet,
+              "Dictionary compression: {} bytes to {} bytes ({:.3f})",
+              bytes_in - logged_in,
+              bytes_out - logged_out,
+              static_cast<double>(bytes_out - logged_out) / static_cast<double>(bytes_in - logged_in));
+          logged_in  = bytes_in;
+          logged_out = bytes_out;
+        }
+
+        // rooms_ belongs to the event loop, so the full dump has to be formatted there
+        if (room_dump_requested.exchange(false, std::memory_order_relaxed))
+        {
+          loop_->defer([this]() { log_rooms(); });
+        }
+
+        if (tracing::take_dump_request())
+        {
+          auto written = tracing::write_chrome_trace(trace_file_);
+          log(written ? spdlog::level::info : spdlog::level::err, "wrote trace to {}: {}", trace_file_.string(), written);
+        }
+
         std::this_thread::sleep_for(interval);
       }
     }};
@@ -174,6 +338,14 @@ namespace websocket_server
 
   WSS::~WSS()
   {
+    loop_->removePostHandler(this);
+
+    if (local_listen_socket_ != nullptr)
+    {
+      us_listen_socket_close(false, local_listen_socket_);
+      fs::remove(local_socket_);
+    }
+
     run_debug_logger_.store(false, std::memory_order_release);
 
 #ifndef __cpp_lib_jthread
@@ -190,9 +362,7 @@ namespace websocket_server
 
   WSS::user_data_type &WSS::user_data(connection_type handle)
   {
-    user_data_type &user_data = *static_cast<user_data_type *>(handle->getUserData());
-
-    return user_data;
+    return handle.user_data();
   }
 
   void WSS::initialize_loggers(const Parameters &parameters)
@@ -276,30 +446,62 @@ namespace websocket_server
 
   void WSS::message_handler(connection_type handle, message_view_type message)
   {
-    auto parsed_data = json::parse(std::string{message});
+    if (tracing::sample_relay()) [[unlikely]]
+    {
+      relay_message<true>(handle, message);
+    }
+    else
+    {
+      relay_message<false>(handle, message);
+    }
+  }
+
+  template <bool Traced>
+  void WSS::relay_message(connection_type handle, message_view_type message)
+  {
+    tracing::Span<Traced> relay_span{"message_handler"};
+
+    if constexpr (Traced)
+    {
+      flush_sampled_ = true;
+    }
+
+    auto parsed_data = [message]() {
+      tracing::Span<Traced> span{"parse"};
+      return json::parse(std::string{message});
+    }();
 
     log(spdlog::level::trace, fmt::color::yellow, "{}", parsed_data);
 
     auto room_id = parsed_data.at("code").get<room_id_type>();
 
-    auto [current_client, added_to_room] = add_client_to_room(room_id, handle);
+    auto [current_client, added_to_room] = add_client_to_room<Traced>(room_id, handle);
 
-    const auto &current_room = rooms_.at(room_id);
+    const auto &current_room = [this, &room_id]() -> const room_type & {
+      tracing::Span<Traced> span{"room lookup"};
+      return rooms_.at(room_id);
+    }();
 
-    parsed_data[peer_id_key] = client_mapping_[*current_client].id();
-    auto new_message         = parsed_data.dump();
+    auto new_message = [this, &parsed_data, current_client = current_client]() {
+      tracing::Span<Traced> span{"serialize"};
+      parsed_data[peer_id_key] = client_mapping_[*current_client].id();
+      return std::make_shared<const message_type>(parsed_data.dump());
+    }();
 
     for (auto peer = current_room.begin(); peer != current_room.end(); ++peer)
     {
       if (current_client != peer)
       {
-        (*peer)->send(new_message, uWS::OpCode::TEXT, compress_outgoing_messages);
+        queue_message(*peer, new_message);
       }
     }
   }
 
+  template <bool Traced>
   std::pair<WSS::room_type::iterator, bool> WSS::add_client_to_room(const room_id_type &room_id, connection_type handle)
   {
+    tracing::Span<Traced> span{"add_client_to_room"};
+
     auto &current_room = rooms_[room_id];
 
     // add client to room if not already present
@@ -307,20 +509,33 @@ namespace websocket_server
 
     if (result.second)
     {
+      // a client that sends another room code joins that room too, but it is still the same client
+      if (client_mapping_[handle].unassigned())
+      {
+        client_count_.fetch_add(1, std::memory_order_relaxed);
+      }
+
       // update internal bookkeeping of client's room
       client_mapping_[handle].assign_room(room_id);
 
+      user_data(handle) = client_mapping_[handle].id();
+
       // notify client of their own UUID
       json client_reply_message = {{peer_id_key, client_mapping_[handle].id()},
                                    {message_type_key, message_type_to_string.at(MessageType::SERVER)},
                                    {data_key, "your id"}};
-      handle->send(client_reply_message.dump(), uWS::OpCode::TEXT, compress_outgoing_messages);
-
-      user_data(handle) = client_mapping_[handle].id();
+      queue_message(handle, std::make_shared<const message_type>(client_reply_message.dump()));
 
       auto uuid = client_mapping_[handle].id();
 
-      log(spdlog::level::debug, fmt::color::dark_turquoise, "Added connection: [room: {}, uuid: {}]", room_id, uuid);
+      record_room_resize(current_room.size() - 1, current_room.size());
+
+      log(spdlog::level::debug,
+          fmt::color::dark_turquoise,
+          "Added connection: [room: {}, uuid: {}, members: {}]",
+          room_id,
+          uuid,
+          current_room.size());
       log(spdlog::level::trace, fmt::color::aquamarine, "{}", client_reply_message);
     }
 
@@ -329,6 +544,26 @@ namespace websocket_server
 
   void WSS::remove_client_from_room(connection_type handle)
   {
+    if (tracing::sample_removal()) [[unlikely]]
+    {
+      remove_client<true>(handle);
+    }
+    else
+    {
+      remove_client<false>(handle);
+    }
+  }
+
+  template <bool Traced>
+  void WSS::remove_client(connection_type handle)
+  {
+    tracing::Span<Traced> span{"remove_client_from_room"};
+
+    if constexpr (Traced)
+    {
+      flush_sampled_ = true;
+    }
+
     constexpr auto uuid_key       = peer_id_key;
     constexpr auto delete_message = "delete";
 
@@ -343,17 +578,129 @@ namespace websocket_server
     current_room.erase(handle);
     client_mapping_.erase(handle);
 
-    log(spdlog::level::debug, fmt::color::dark_turquoise, "removed client {} from room {}", client_uuid, room_id);
+    // the socket is gone once this handler returns, so anything still queued for it can never be written
+    if (!handle.pending_messages().empty())
+    {
+      std::erase(dirty_connections_, handle);
+    }
+
+    client_count_.fetch_sub(1, std::memory_order_relaxed);
+    record_room_resize(current_room.size() + 1, current_room.size());
+
+    log(spdlog::level::debug,
+        fmt::color::dark_turquoise,
+        "removed client {} from room {} [members: {}]",
+        client_uuid,
+        room_id,
+        current_room.size());
     log(spdlog::level::trace, fmt::color::aquamarine, "{}", message);
 
+    auto shared_message = std::make_shared<const message_type>(message.dump());
     for (auto peer = current_room.begin(); peer != current_room.end(); ++peer)
     {
-      (*peer)->send(message.dump(), uWS::OpCode::TEXT, compress_outgoing_messages);
+      queue_message(*peer, shared_message);
     }
 
     auto room_closed = close_if_empty(room_id);
   }
 
+  void WSS::queue_message(connection_type peer, const shared_message_type &message)
+  {
+    auto &pending = peer.pending_messages();
+    if (pending.empty())
+    {
+      dirty_connections_.push_back(peer);
+    }
+    pending.push_back(message);
+
+    // unbatched mode reproduces the old one-write-per-send behaviour, for comparisons with fanout_bench
+    if (!batch_fan_out_)
+    {
+      flush_pending_messages();
+    }
+  }
+
+  void WSS::flush_pending_messages()
+  {
+    // the flush does not draw its own sample, it is traced only when it carries a sampled relay or removal
+    auto sampled = std::exchange(flush_sampled_, false);
+
+    if (dirty_connections_.empty())
+    {
+      return;
+    }
+
+    if (sampled) [[unlikely]]
+    {
+      flush_messages<true>();
+    }
+    else
+    {
+      flush_messages<false>();
+    }
+  }
+
+  template <bool Traced>
+  void WSS::flush_messages()
+  {
+    tracing::Span<Traced> flush_span{"flush"};
+
+    // each message is dictionary compressed at most once per flush, however many capable peers receive it. a failed
+    // compression is cached as well, those peers get the plain text frame instead
+    std::unordered_map<const message_type *, std::optional<std::string>> dictionary_compressed;
+    auto compressed = [this, &dictionary_compressed](const message_type &message) -> const std::optional<std::string> & {
+      auto [entry, inserted] = dictionary_compressed.try_emplace(&message);
+      if (inserted)
+      {
+        tracing::Span<Traced> span{"dictionary compress"};
+        entry->second = dictionary_compressor_.compress(message);
+
+        if (entry->second)
+        {
+          dictionary_bytes_in_.fetch_add(message.size(), std::memory_order_relaxed);
+          dictionary_bytes_out_.fetch_add(entry->second->size(), std::memory_order_relaxed);
+        }
+        else
+        {
+          log(spdlog::level::warn, fmt::color::orange_red, "dictionary compression failed, sending uncompressed");
+        }
+      }
+      return entry->second;
+    };
+
+    std::uint64_t sent = 0;
+    for (const auto &peer : dirty_connections_)
+    {
+      // permessage-deflate happens inside send(), so this span covers both compression and the write
+      tracing::Span<Traced> span{"compress + send"};
+
+      auto &messages = peer.pending_messages();
+      peer.cork([&peer, &messages, &compressed]() {
+        for (const auto &message : messages)
+        {
+          if (peer.dictionary_compression())
+          {
+            if (const auto &frame = compressed(*message))
+            {
+              peer.send(*frame, uWS::OpCode::BINARY, false);
+              continue;
+            }
+          }
+
+          peer.send(*message, uWS::OpCode::TEXT, compress_outgoing_messages);
+        }
+      });
+
+      sent += messages.size();
+      messages.clear();
+    }
+
+    sent_messages_.fetch_add(sent, std::memory_order_relaxed);
+    peer_flushes_.fetch_add(dirty_connections_.size(), std::memory_order_relaxed);
+
+    dirty_connections_.clear();
+  }
+
   bool WSS::close_if_empty(const room_id_type &room_id)
   {
     if (rooms_.contains(room_id) && rooms_[room_id].empty())
@@ -365,13 +712,131 @@ namespace websocket_server
     return false;
   }
 
+  void WSS::record_room_resize(std::size_t old_size, std::size_t new_size)
+  {
+    auto bucket = [](std::size_t size) {
+      return std::min<std::size_t>(std::bit_width(size - 1), room_size_buckets - 1);
+    };
+
+    if (old_size > 0)
+    {
+      room_size_histogram_[bucket(old_size)].fetch_sub(1, std::memory_order_relaxed);
+    }
+    if (new_size > 0)
+    {
+      room_size_histogram_[bucket(new_size)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    membership_version_.fetch_add(1, std::memory_order_release);
+  }
+
+  void WSS::log_membership_summary()
+  {
+    std::size_t room_count = 0;
+    std::vector<std::string> sizes;
+
+    for (std::size_t bucket = 0; bucket < room_size_buckets; ++bucket)
+    {
+      auto count = room_size_histogram_[bucket].load(std::memory_order_relaxed);
+      room_count += count;
+
+      if (count == 0)
+      {
+        continue;
+      }
+
+      auto lower = (bucket == 0) ? 1 : (std::size_t{1} << (bucket - 1)) + 1;
+      auto upper = std::size_t{1} << bucket;
+
+      if (bucket == room_size_buckets - 1)
+      {
+        sizes.push_back(fmt::format("{}+: {}", lower, count));
+      }
+      else if (lower == upper)
+      {
+        sizes.push_back(fmt::format("{}: {}", lower, count));
+      }
+      else
+      {
+        sizes.push_back(fmt::format("{}-{}: {}", lower, upper, count));
+      }
+    }
+
+    log(spdlog::level::debug,
+        fmt::color::violet,
+        "Rooms: {}, clients: {}, members per room: {{{}}}",
+        room_count,
+        client_count_.load(std::memory_order_relaxed),
+        fmt::join(sizes, ", "));
+  }
+
+  void WSS::log_rooms()
+  {
+    log(spdlog::level::info, fmt::color::violet, "Rooms:{}{:2}", rooms_.empty() ? "" : "\n", rooms_);
+  }
+
+  void WSS::listen_local()
+  {
+    // a socket file left behind by a previous run would make listening fail
+    if (fs::is_socket(local_socket_))
+    {
+      fs::remove(local_socket_);
+    }
+
+    // uWS v19 only listens on tcp and keeps its http socket context private. a throwaway loopback listener on an
+    // ephemeral port hands us that context, which uSockets then binds to the unix domain socket instead.
+    local_server_.listen("127.0.0.1", 0, [this](auto listen_socket) {
+      if (listen_socket)
+      {
+        auto *context = us_socket_context(false, reinterpret_cast<us_socket_t *>(listen_socket));
+        us_listen_socket_close(false, listen_socket);
+
+        local_listen_socket_ = us_socket_context_listen_unix(
+            false, context, local_socket_.string().c_str(), 0, sizeof(uWS::HttpResponseData<false>));
+      }
+    });
+
+    // local peers skip TLS and may fetch the trace, so only the server's user and group may connect
+    if (local_listen_socket_ != nullptr)
+    {
+      std::error_code error;
+      fs::permissions(local_socket_,
+                      fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read | fs::perms::group_write,
+                      error);
+      if (error)
+      {
+        log(spdlog::level::critical,
+            fmt::color::orange_red,
+            "unable to restrict access to local socket {}: {}",
+            local_socket_.string(),
+            error.message());
+
+        us_listen_socket_close(false, local_listen_socket_);
+        local_listen_socket_ = nullptr;
+        fs::remove(local_socket_, error);
+      }
+    }
+
+    if (local_listen_socket_ != nullptr)
+    {
+      log(spdlog::level::info, fmt::color::lime_green, "initialized local ws server on socket: {}", local_socket_.string());
+    }
+    else
+    {
+      log(spdlog::level::critical,
+          fmt::color::orange_red,
+          "unable to initialize local ws server on socket: {}",
+          local_socket_.string());
+    }
+  }
+
   void WSS::http_handler(connection_type handle)
   {
     log(spdlog::level::debug,
         fmt::color::hot_pink,
-        "received new connection request: [{}:{}]",
-        handle->getRemoteAddress(),
-        handle->getRemoteAddressAsText());
+        "received new {} connection request: [{}]",
+        handle.is_local() ? "local" : "remote",
+        handle.remote_address());
   }
 
 } // namespace websocket_server
@@ -3,26 +3,26 @@
 #include <App.h>
 
 #include "ClientInfo.h"
+#include "Connection.h"
+#include "DictionaryCompressor.h"
 
+#include <array>
 #include <atomic>
 #include <cstdint>
 #include <filesystem>
 #include <map>
+#include <memory>
 #include <set>
 #include <thread>
 #include <unordered_map>
-#include <variant>
+#include <vector>
 
 namespace websocket_server
 {
   namespace fs = std::filesystem;
 
-#ifdef WS_NO_TLS
-  constexpr bool using_TLS = false;
-#else
-  constexpr bool using_TLS = true;
-#endif
-  constexpr bool compress_outgoing_messages = true;
+  constexpr bool compress_outgoing_messages   = true;
+  constexpr bool offer_dictionary_compression = true;
 
   struct Parameters
   {
@@ -35,6 +35,13 @@ namespace websocket_server
 
     float max_log_mb;
     fs::path log_file;
+
+    fs::path local_socket;
+    bool batch_fan_out;
+
+    std::uint32_t trace_sample_period;
+    std::size_t trace_buffer_events;
+    fs::path trace_file;
   };
 
   class WSS
@@ -53,17 +60,18 @@ namespace websocket_server
 
   private:
     using server_backend_type = uWS::TemplatedApp<using_TLS>;
-    using socket_type         = uWS::WebSocket<using_TLS, true>;
+    using local_backend_type  = uWS::TemplatedApp<false>;
     using message_type        = std::string;
     using message_view_type   = std::string_view;
+    using shared_message_type = Connection::shared_message_type;
 
     using client_type    = ClientInfo;
     using client_id_type = client_type::client_id_type;
     using room_id_type   = client_type::room_id_type;
 
   public:
-    using connection_type = socket_type *;
-    using user_data_type  = client_id_type;
+    using connection_type = Connection;
+    using user_data_type  = Connection::user_data_type;
 
     static user_data_type &user_data(connection_type handle);
 
@@ -88,25 +96,73 @@ namespace websocket_server
     using thread_type = std::thread;
 #endif
 
+    // bucket b holds rooms with (2^(b-1), 2^b] members, the last bucket holds everything larger
+    static constexpr std::size_t room_size_buckets = 8;
+    using room_size_histogram_type                 = std::array<std::atomic<std::size_t>, room_size_buckets>;
+
     static void initialize_loggers(const Parameters &);
 
     template <typename LogLevel, class... Args>
     static void log(LogLevel, Args &&...);
 
+    // the same room logic serves both listeners; local peers skip compression and may send binary frames.
+    template <bool Local>
+    auto make_behavior();
+
+    // the untraced instantiations (Traced = false) compile every tracing span away
     void message_handler(connection_type handle, message_view_type message);
+    template <bool Traced>
+    void relay_message(connection_type handle, message_view_type message);
 
+    template <bool Traced>
     std::pair<room_type::iterator, bool> add_client_to_room(const room_id_type &room_id, connection_type handle);
     void remove_client_from_room(connection_type handle);
+    template <bool Traced>
+    void remove_client(connection_type handle);
     bool close_if_empty(const room_id_type &room_id);
 
+    // outgoing messages are gathered per peer for the whole loop iteration, then written in one corked flush
+    void queue_message(connection_type peer, const shared_message_type &message);
+    void flush_pending_messages();
+    template <bool Traced>
+    void flush_messages();
+
+    void record_room_resize(std::size_t old_size, std::size_t new_size);
+    void log_membership_summary();
+    void log_rooms();
+
     void http_handler(connection_type handle);
 
+    void listen_local();
+
     const std::string key_;
     const std::string cert_;
+    const fs::path trace_file_;
+    const fs::path local_socket_;
+    const bool batch_fan_out_;
 
     server_backend_type server_;
+    local_backend_type local_server_;
+    us_listen_socket_t *local_listen_socket_;
+    DictionaryCompressor dictionary_compressor_;
     rooms_container_type rooms_;
     client_lookup_type client_mapping_;
+    std::vector<connection_type> dirty_connections_; // connections with pending messages, reused across iterations
+
+    uWS::Loop *loop_;
+    bool flush_sampled_;
+
+    // fan-out statistics, written on the event loop and read by the debug logger thread. a peer flush is one corked
+    // send of a peer's queue; how many syscalls that turns into is measured by fanout_bench, not here
+    std::atomic<std::uint64_t> sent_messages_;
+    std::atomic<std::uint64_t> peer_flushes_;
+    std::atomic<std::uint64_t> dictionary_bytes_in_;
+    std::atomic<std::uint64_t> dictionary_bytes_out_;
+
+    // membership statistics are written on the event loop and read by the debug logger thread
+    std::atomic<std::uint64_t> membership_version_;
+    std::atomic<std::size_t> client_count_;
+    room_size_histogram_type room_size_histogram_;
 
     thread_type debug_logger_;
     std::atomic<bool> run_debug_logger_;
@@ -0,0 +1,199 @@
+#include "tracing.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <bit>
+#include <csignal>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace websocket_server::tracing
+{
+  namespace
+  {
+    struct Event
+    {
+      const char *name;
+      clock_type::time_point start;
+      clock_type::time_point end;
+    };
+
+    // single producer (the owning thread), any number of readers. each slot is guarded by a sequence number so a
+    // reader can detect (and drop) an event that was overwritten while it was being copied.
+    class RingBuffer
+    {
+    public:
+      RingBuffer(std::size_t capacity, std::size_t thread_index) :
+          slots_(std::bit_ceil(std::max<std::size_t>(capacity, 1))), mask_(slots_.size() - 1), thread_index_(thread_index)
+      {
+      }
+
+      void push(const Event &event)
+      {
+        const auto index = head_.load(std::memory_order_relaxed);
+        auto &slot       = slots_[index & mask_];
+
+        slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.name.store(event.name, std::memory_order_relaxed);
+        slot.start.store(event.start.time_since_epoch().count(), std::memory_order_relaxed);
+        slot.end.store(event.end.time_since_epoch().count(), std::memory_order_relaxed);
+        slot.sequence.store(2 * index + 2, std::memory_order_release);
+
+        head_.store(index + 1, std::memory_order_release);
+      }
+
+      template <typename Callback>
+      void for_each(Callback &&callback) const
+      {
+        const auto head  = head_.load(std::memory_order_acquire);
+        const auto first = (head > slots_.size()) ? head - slots_.size() : 0;
+
+        for (auto index = first; index < head; ++index)
+        {
+          const auto &slot    = slots_[index & mask_];
+          const auto sequence = slot.sequence.load(std::memory_order_acquire);
+          const Event event{slot.name.load(std::memory_order_relaxed),
+                            clock_type::time_point{clock_type::duration{slot.start.load(std::memory_order_relaxed)}},
+                            clock_type::time_point{clock_type::duration{slot.end.load(std::memory_order_relaxed)}}};
+          std::atomic_thread_fence(std::memory_order_acquire);
+
+          if (sequence == 2 * index + 2 && slot.sequence.load(std::memory_order_relaxed) == sequence)
+          {
+            callback(event);
+          }
+        }
+      }
+
+      [[nodiscard]] std::size_t thread_index() const
+      {
+        return thread_index_;
+      }
+
+    private:
+      // the event is stored field by field in relaxed atomics: the reader may copy a slot while it is being
+      // overwritten, and the sequence number only tells it afterwards to drop what it read
+      struct Slot
+      {
+        std::atomic<std::uint64_t> sequence{0};
+        std::atomic<const char *> name{nullptr};
+        std::atomic<clock_type::rep> start{0};
+        std::atomic<clock_type::rep> end{0};
+      };
+
+      std::vector<Slot> slots_;
+      const std::uint64_t mask_;
+      const std::size_t thread_index_;
+      std::atomic<std::uint64_t> head_{0};
+    };
+
+    std::size_t buffer_capacity = 0;
+
+    std::mutex registry_mutex;
+    std::vector<std::shared_ptr<RingBuffer>> registry;
+
+    std::atomic<bool> dump_requested{false};
+
+    const clock_type::time_point epoch = clock_type::now();
+
+    RingBuffer &local_buffer()
+    {
+      thread_local std::shared_ptr<RingBuffer> buffer = []() {
+        std::scoped_lock lock(registry_mutex);
+        return registry.emplace_back(std::make_shared<RingBuffer>(buffer_capacity, registry.size()));
+      }();
+
+      return *buffer;
+    }
+
+    void handle_dump_signal(int /*signal*/)
+    {
+      dump_requested.store(true, std::memory_order_relaxed);
+    }
+  } // namespace
+
+  namespace detail
+  {
+    bool advance_countdown(std::uint32_t &countdown)
+    {
+      if (countdown == 0)
+      {
+        countdown = sample_period;
+      }
+
+      return --countdown == 0;
+    }
+
+    void record(const char *name, clock_type::time_point start, clock_type::time_point end)
+    {
+      local_buffer().push({name, start, end});
+    }
+  } // namespace detail
+
+  void configure(std::uint32_t sample_period, std::size_t events_per_thread)
+  {
+    detail::sample_period = sample_period;
+    buffer_capacity       = events_per_thread;
+
+#ifdef SIGUSR1
+    if (sample_period != 0)
+    {
+      std::signal(SIGUSR1, handle_dump_signal);
+    }
+#endif
+  }
+
+  bool enabled()
+  {
+    return detail::sample_period != 0;
+  }
+
+  std::string chrome_trace()
+  {
+    using microseconds = std::chrono::duration<double, std::micro>;
+
+    std::vector<std::shared_ptr<RingBuffer>> buffers;
+    {
+      std::scoped_lock lock(registry_mutex);
+      buffers = registry;
+    }
+
+    fmt::memory_buffer out;
+    fmt::format_to(std::back_inserter(out), R"({{"displayTimeUnit":"ns","traceEvents":[)");
+
+    auto first = true;
+    for (const auto &buffer : buffers)
+    {
+      buffer->for_each([&out, &first, tid = buffer->thread_index()](const Event &event) {
+        fmt::format_to(std::back_inserter(out),
+                       R"({}{{"name":"{}","cat":"relay","ph":"X","pid":1,"tid":{},"ts":{:.3f},"dur":{:.3f}}})",
+                       first ? "" : ",",
+                       event.name,
+                       tid,
+                       microseconds(event.start - epoch).count(),
+                       microseconds(event.end - event.start).count());
+        first = false;
+      });
+    }
+
+    fmt::format_to(std::back_inserter(out), "]}}");
+
+    return fmt::to_string(out);
+  }
+
+  bool write_chrome_trace(const fs::path &file)
+  {
+    std::ofstream stream(file, std::ios::trunc);
+    stream << chrome_trace();
+
+    return stream.good();
+  }
+
+  bool take_dump_request()
+  {
+    return dump_requested.exchange(false, std::memory_order_relaxed);
+  }
+} // namespace websocket_server::tracing
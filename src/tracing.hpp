@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace websocket_server::tracing
+{
+  namespace fs = std::filesystem;
+
+  using clock_type = std::chrono::steady_clock;
+
+  namespace detail
+  {
+    // written once by configure() before the event loop starts, read-only afterwards. 0 disables tracing.
+    inline std::uint32_t sample_period = 0;
+
+    // relays and removals count down separately, so removals never shift which relays get traced
+    inline thread_local std::uint32_t relay_countdown   = 0;
+    inline thread_local std::uint32_t removal_countdown = 0;
+
+    bool advance_countdown(std::uint32_t &countdown);
+    void record(const char *name, clock_type::time_point start, clock_type::time_point end);
+
+    [[nodiscard]] inline bool sample(std::uint32_t &countdown)
+    {
+      if (sample_period == 0) [[likely]]
+      {
+        return false;
+      }
+
+      return advance_countdown(countdown);
+    }
+  } // namespace detail
+
+  // sample_period: trace one in every `sample_period` relays and removals (0 disables tracing entirely).
+  // events_per_thread: capacity of each thread's ring buffer, rounded up to a power of two.
+  void configure(std::uint32_t sample_period, std::size_t events_per_thread);
+
+  [[nodiscard]] bool enabled();
+
+  // serializes the contents of every thread's ring buffer in chrome `trace_event` format (loadable in Perfetto).
+  [[nodiscard]] std::string chrome_trace();
+  bool write_chrome_trace(const fs::path &file);
+
+  // set asynchronously by SIGUSR1 (where available), consumed by whoever polls for it.
+  [[nodiscard]] bool take_dump_request();
+
+  // decide whether the next relayed message / client removal is traced, 1 in every `sample_period` of each. when tracing
+  // is disabled this is the only cost: a single predictable branch, after which the caller runs its Span<false>
+  // instantiation with no-op spans.
+  [[nodiscard]] inline bool sample_relay()
+  {
+    return detail::sample(detail::relay_countdown);
+  }
+
+  [[nodiscard]] inline bool sample_removal()
+  {
+    return detail::sample(detail::removal_countdown);
+  }
+
+  template <bool Traced>
+  class Span
+  {
+  public:
+    explicit Span(const char *name) : name_(name), start_(clock_type::now())
+    {
+    }
+
+    ~Span()
+    {
+      detail::record(name_, start_, clock_type::now());
+    }
+
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+  private:
+    const char *name_;
+    clock_type::time_point start_;
+  };
+
+  template <>
+  class Span<false>
+  {
+  public:
+    explicit Span(const char * /*name*/)
+    {
+    }
+  };
+} // namespace websocket_server::tracing
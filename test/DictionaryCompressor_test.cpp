@@ -0,0 +1,83 @@
+#include "DictionaryCompressor.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace
+{
+  int failures = 0;
+
+  void check(bool condition, const char *description)
+  {
+    if (!condition)
+    {
+      std::cerr << "FAILED: " << description << '\n';
+      ++failures;
+    }
+  }
+
+  const std::string candidate =
+      R"({"code":"room","content":{"candidate":"candidate:842163049 1 udp 1677729535 203.0.113.7 61534 typ srflx raddr )"
+      R"(0.0.0.0 rport 0 generation 0 ufrag sK3d network-cost 999","sdpMLineIndex":0,"sdpMid":"0","usernameFragment":)"
+      R"("sK3d"},"message_type":"CANDIDATE","peer_id":"3f2c6c5e-0d1b-4f0e-9a4c-1d2e3f405162"})";
+} // namespace
+
+int main()
+{
+  using websocket_server::DictionaryCompressor;
+
+  DictionaryCompressor compressor;
+
+  // round trip, including the empty message
+  for (const std::string &message : {candidate, std::string{}})
+  {
+    auto frame = compressor.compress(message);
+    check(frame.has_value(), "compress succeeds");
+    if (frame)
+    {
+      check(!frame->empty() && static_cast<std::uint8_t>((*frame)[0]) == DictionaryCompressor::version,
+            "frame starts with the dictionary version");
+
+      auto decompressed = compressor.decompress(*frame);
+      check(decompressed == message, "round trip restores the message");
+    }
+  }
+
+  auto frame = compressor.compress(candidate);
+  check(frame && frame->size() < candidate.size() / 2, "the dictionary at least halves a typical candidate");
+
+  if (frame)
+  {
+    // truncated input: the deflate stream never ends
+    check(!compressor.decompress(frame->substr(0, frame->size() / 2)), "truncated frame is rejected");
+    check(!compressor.decompress(frame->substr(0, 1)), "version byte only is rejected");
+
+    // bad version byte
+    auto wrong_version = *frame;
+    wrong_version[0]   = static_cast<char>(DictionaryCompressor::version + 1);
+    check(!compressor.decompress(wrong_version), "unknown dictionary version is rejected");
+
+    // the decompressor stays usable after rejecting a frame
+    check(compressor.decompress(*frame) == candidate, "round trip after a rejected frame");
+  }
+  check(!compressor.decompress(""), "empty frame is rejected");
+
+  // size cap: a tiny frame must not inflate past max_decompressed_size
+  const std::string at_cap(DictionaryCompressor::max_decompressed_size, 'a');
+  const std::string over_cap(2 * DictionaryCompressor::max_decompressed_size, 'a');
+  auto at_cap_frame   = compressor.compress(at_cap);
+  auto over_cap_frame = compressor.compress(over_cap);
+  check(at_cap_frame && compressor.decompress(*at_cap_frame) == at_cap, "message at the size cap is accepted");
+  check(over_cap_frame && !compressor.decompress(*over_cap_frame), "message over the size cap is rejected");
+
+  // subprotocol negotiation
+  check(DictionaryCompressor::requested(DictionaryCompressor::subprotocol), "single subprotocol");
+  check(DictionaryCompressor::requested(std::string("chat, ") + DictionaryCompressor::subprotocol + " ,other"),
+        "subprotocol in a list");
+  check(!DictionaryCompressor::requested("chat, other"), "subprotocol not offered");
+  check(!DictionaryCompressor::requested(""), "no subprotocols");
+
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}